@@ -72,6 +72,18 @@ warndbg(const char *fmt, ...)
         }
 }
 
+static inline void  __attribute__((format(printf, 1, 2), nonnull(1)))
+warnxdbg(const char *fmt, ...)
+{
+        va_list ap;
+
+        if (debug_flag) {
+            va_start(ap, fmt);
+            vwarnx(fmt, ap);
+            va_end(ap);
+        }
+}
+
 static inline bool
 strnull(const char *str)
 {
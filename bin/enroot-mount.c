@@ -22,6 +22,8 @@
 #include <libgen.h>
 #include <limits.h>
 #include <mntent.h>
+#include <search.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +31,7 @@
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -43,13 +46,131 @@
 
 #define MS_PROPAGATION (unsigned long)(MS_PRIVATE|MS_SHARED|MS_SLAVE|MS_UNBINDABLE)
 
+#ifndef SYS_open_tree
+# define SYS_open_tree 428
+#endif
+#ifndef SYS_move_mount
+# define SYS_move_mount 429
+#endif
+#ifndef SYS_fsopen
+# define SYS_fsopen 430
+#endif
+#ifndef SYS_fsconfig
+# define SYS_fsconfig 431
+#endif
+#ifndef SYS_fsmount
+# define SYS_fsmount 432
+#endif
+#ifndef SYS_mount_setattr
+# define SYS_mount_setattr 442
+#endif
+
+#ifndef SYS_openat2
+# define SYS_openat2 437
+#endif
+
+#ifndef AT_RECURSIVE
+# define AT_RECURSIVE 0x8000
+#endif
+#ifndef OPEN_TREE_CLONE
+# define OPEN_TREE_CLONE 1
+#endif
+#ifndef OPEN_TREE_CLOEXEC
+# define OPEN_TREE_CLOEXEC O_CLOEXEC
+#endif
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+# define MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#endif
+#ifndef FSOPEN_CLOEXEC
+# define FSOPEN_CLOEXEC 0x00000001
+# define FSCONFIG_SET_FLAG 0
+# define FSCONFIG_SET_STRING 1
+# define FSCONFIG_CMD_CREATE 6
+#endif
+#ifndef FSMOUNT_CLOEXEC
+# define FSMOUNT_CLOEXEC 0x00000001
+#endif
+
+#ifndef OPEN_HOW_SIZE_VER0
+# define OPEN_HOW_SIZE_VER0 24
+struct open_how {
+        uint64_t flags;
+        uint64_t mode;
+        uint64_t resolve;
+};
+#endif
+#ifndef RESOLVE_NO_MAGICLINKS
+# define RESOLVE_NO_MAGICLINKS 0x02
+#endif
+#ifndef RESOLVE_IN_ROOT
+# define RESOLVE_IN_ROOT 0x10
+#endif
+
+#ifndef MOUNT_ATTR_SIZE_VER0
+# define MOUNT_ATTR_SIZE_VER0 32
+struct mount_attr {
+        uint64_t attr_set;
+        uint64_t attr_clr;
+        uint64_t propagation;
+        uint64_t userns_fd;
+};
+#endif
+#ifndef MOUNT_ATTR_RDONLY
+# define MOUNT_ATTR_RDONLY      0x00000001
+# define MOUNT_ATTR_NOSUID      0x00000002
+# define MOUNT_ATTR_NODEV       0x00000004
+# define MOUNT_ATTR_NOEXEC      0x00000008
+# define MOUNT_ATTR__ATIME      0x00000070
+# define MOUNT_ATTR_RELATIME    0x00000000
+# define MOUNT_ATTR_NOATIME     0x00000010
+# define MOUNT_ATTR_STRICTATIME 0x00000020
+# define MOUNT_ATTR_NODIRATIME  0x00000080
+#endif
+
 struct mount_opt {
         const char *name;
         unsigned long flag;
         int clear;
 };
 
+/* Mount entry along with its parsed options. */
+struct mount_spec {
+        struct mntent mnt;
+        unsigned long flags;
+        char *data;
+        mode_t create;
+};
+
+/* Mount plan entry, followed by the fsname, dir, type, opts and data strings (NUL-terminated). */
+#define PLAN_MAGIC "ENROOT-PLAN-1\n"
+struct plan_entry {
+        int32_t passno;
+        uint32_t create;
+        uint64_t flags;
+        uint32_t size;
+        uint32_t reserved;
+};
+
 static struct capabilities_v3 caps;
+static bool mount_api = false;
+static bool mount_api_supported = true;
+
+/* Number of mount related syscalls (including capability changes) issued for the current entry. */
+static unsigned int nsyscalls;
+static bool openat2_api = true;
+
+/* Directories known to exist, kept across all the entries processed (including serve requests). */
+static void *dircache;
+
+/* Detached copy of the root directory mount where x-tree entries get assembled before being attached at once. */
+static struct {
+        int fd;
+        bool unsupported;
+        char root[PATH_MAX];
+        size_t rootlen;
+        struct { char *path; unsigned long prop; unsigned int recprop; } *targets;
+        size_t ntargets;
+} tree = {.fd = -1};
 
 static const struct mount_opt mount_opts[] = {
         {"async",         MS_SYNCHRONOUS, 1},
@@ -110,6 +231,15 @@ static const struct mount_opt mount_opts[] = {
         {"x-create=auto", 0, 0},
         {"x-move", MS_MOVE, 0},
         {"x-detach", MNT_DETACH, 0},
+        {"x-recursive-attr", 0, 0},
+        {"x-tree", 0, 0},
+};
+
+static const struct { unsigned long flag; const char *ropt; } propagation[] = {
+        {MS_SHARED, "rshared"},
+        {MS_SLAVE, "rslave"},
+        {MS_PRIVATE, "rprivate"},
+        {MS_UNBINDABLE, "runbindable"},
 };
 
 static void
@@ -208,6 +338,42 @@ reopenat(int *dirfd, const char *path, int flags)
         return (0);
 }
 
+/*
+ * Resolve a path relative to a root directory in a single openat2(2) call (Linux 5.6) and read it back from procfs.
+ * Return -1 if it can't be resolved this way (e.g. missing components), leaving realpathat to walk it in userspace.
+ */
+static int
+resolve_in_root(const char *dir, const char *path, char *resolved_path)
+{
+        struct open_how how = {
+                .flags = O_PATH|O_CLOEXEC,
+                .resolve = RESOLVE_IN_ROOT|RESOLVE_NO_MAGICLINKS,
+        };
+        char proc[32];
+        int dirfd, fd = -1;
+        int rv = -1;
+
+        if (!openat2_api)
+                return (-1);
+
+        if ((dirfd = open(dir, O_PATH|O_DIRECTORY|O_CLOEXEC)) < 0)
+                return (-1);
+        if ((fd = (int)syscall(SYS_openat2, dirfd, path, &how, sizeof(how))) < 0) {
+                if (errno == ENOSYS)
+                        openat2_api = false;
+                goto err;
+        }
+        snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+        if (xreadlinkat(AT_FDCWD, proc, resolved_path, PATH_MAX) < 0 || *resolved_path != '/')
+                goto err;
+        rv = 0;
+
+ err:
+        SAVE_ERRNO(close(fd));
+        SAVE_ERRNO(close(dirfd));
+        return (rv);
+}
+
 static int
 realpathat(const char *dir, const char *path, char *resolved_path)
 {
@@ -219,6 +385,9 @@ realpathat(const char *dir, const char *path, char *resolved_path)
         unsigned int noent_depth = 0;
         unsigned int link_depth = 0;
 
+        if (resolve_in_root(dir, path, resolved_path) == 0)
+                return (0);
+
         *res = '\0';
         link = buf[0];
         next = buf[1];
@@ -321,39 +490,115 @@ realpathat(const char *dir, const char *path, char *resolved_path)
 }
 
 static int
-create_file(const char *path, mode_t mode)
+dircache_cmp(const void *a, const void *b)
 {
-        int rv = -1;
-        char *dup = NULL, *dir = NULL, *next;
+        return (strcmp(a, b));
+}
 
-        if ((dup = strdup(path)) == NULL)
+static int
+dircache_add(const char *dir)
+{
+        char *dup, **node;
+
+        if ((dup = strdup(dir)) == NULL)
+                return (-1);
+        if ((node = tsearch(dup, &dircache, dircache_cmp)) == NULL) {
+                free(dup);
+                errno = ENOMEM;
+                return (-1);
+        }
+        if (*node != dup)
+                free(dup);
+        return (0);
+}
+
+static void
+dircache_flush(void)
+{
+        tdestroy(dircache, free);
+        dircache = NULL;
+}
+
+static int
+create_file_cached(const char *path, mode_t mode)
+{
+        int fd = -1, rv = -1;
+        char *dir, *next, c;
+        const char *base;
+        size_t n, len;
+        bool found;
+
+        if ((dir = strdup(path)) == NULL)
+                return (-1);
+        if ((next = strrchr(dir, '/')) == NULL || next[1] == '\0') {
+                errno = EINVAL;
                 goto err;
-        if ((next = dir = strdup(dirname(dup))) == NULL)
+        }
+        *next = '\0';
+        base = path + (next - dir) + 1;
+
+        /* Look for the deepest ancestor known to exist, and create the missing ones relative to it. */
+        for (n = len = strlen(dir); n > 0; ) {
+                dir[n] = '\0';
+                found = tfind(dir, &dircache, dircache_cmp) != NULL;
+                if (n < len)
+                        dir[n] = '/';
+                if (found)
+                        break;
+                while (--n > 0 && dir[n] != '/');
+        }
+        c = dir[n];
+        dir[n] = '\0';
+        if ((fd = open(n > 0 ? dir : "/", O_PATH|O_DIRECTORY|O_CLOEXEC)) < 0)
                 goto err;
+        dir[n] = c;
 
-        while (strsep(&next, "/") != NULL) {
-                if (*dir != '\0') {
-                        if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+        for (next = dir + n; strsep(&next, "/") != NULL;) {
+                if (dir[n] != '\0') {
+                        if (mkdirat(fd, dir + n, 0755) < 0 && errno != EEXIST)
+                                goto err;
+                        if (reopenat(&fd, dir + n, O_PATH|O_DIRECTORY) < 0)
+                                goto err;
+                        if (dircache_add(dir) < 0)
                                 goto err;
                 }
-                if (next != dir && next != NULL)
+                if (next != NULL) {
+                        n = (size_t)(next - dir);
                         next[-1] = '/';
+                }
         }
+
         if (S_ISDIR(mode)) {
-                if (mkdir(path, mode & (mode_t) ~S_IFMT) < 0 && errno != EEXIST)
+                if (mkdirat(fd, base, mode & (mode_t) ~S_IFMT) < 0 && errno != EEXIST)
+                        goto err;
+                if (dircache_add(path) < 0)
                         goto err;
         } else {
-                if (mknod(path, mode, 0) < 0 && errno != EEXIST)
+                if (mknodat(fd, base, mode, 0) < 0 && errno != EEXIST)
                         goto err;
         }
         rv = 0;
 
  err:
-        free(dup);
+        SAVE_ERRNO(close(fd));
         free(dir);
         return (rv);
 }
 
+static int
+create_file(const char *path, mode_t mode)
+{
+        if (create_file_cached(path, mode) == 0)
+                return (0);
+
+        /* Directories in the cache might have been removed or mounted over since, retry without it. */
+        if ((errno == ENOENT || errno == ENOTDIR) && dircache != NULL) {
+                dircache_flush();
+                return (create_file_cached(path, mode));
+        }
+        return (-1);
+}
+
 static int
 parse_mount_opts(const char *opts, char **data, unsigned long *flags)
 {
@@ -392,18 +637,29 @@ parse_mount_opts(const char *opts, char **data, unsigned long *flags)
         return (rv);
 }
 
+static int
+set_sysadmin(bool raise)
+{
+        if (raise)
+                CAP_SET(&caps, effective, CAP_SYS_ADMIN);
+        else
+                CAP_CLR(&caps, effective, CAP_SYS_ADMIN);
+
+        ++nsyscalls;
+        return (capset(&caps.hdr, caps.data));
+}
+
 static int
 do_mount(const char *src, const char *dst, const char *type, unsigned long flags, const void *data)
 {
-        CAP_SET(&caps, effective, CAP_SYS_ADMIN);
-        if (capset(&caps.hdr, caps.data) < 0)
+        if (set_sysadmin(true) < 0)
                 return (-1);
 
+        ++nsyscalls;
         if (mount(src, dst, type, flags, data) < 0)
                 return (-1);
 
-        CAP_CLR(&caps, effective, CAP_SYS_ADMIN);
-        if (capset(&caps.hdr, caps.data) < 0)
+        if (set_sysadmin(false) < 0)
                 return (-1);
         return (0);
 }
@@ -411,21 +667,85 @@ do_mount(const char *src, const char *dst, const char *type, unsigned long flags
 static int
 do_umount(const char *target, int flags)
 {
-        CAP_SET(&caps, effective, CAP_SYS_ADMIN);
-        if (capset(&caps.hdr, caps.data) < 0)
+        if (set_sysadmin(true) < 0)
                 return (-1);
 
+        ++nsyscalls;
         if (umount2(target, flags) < 0)
                 return (-1);
 
-        CAP_CLR(&caps, effective, CAP_SYS_ADMIN);
-        if (capset(&caps.hdr, caps.data) < 0)
+        if (set_sysadmin(false) < 0)
                 return (-1);
         return (0);
 }
 
 static int
-mount_generic(const char *dst, const struct mntent *mnt, unsigned long flags, const char *data)
+sys_open_tree(int dirfd, const char *path, unsigned int flags)
+{
+        ++nsyscalls;
+        return ((int)syscall(SYS_open_tree, dirfd, path, flags));
+}
+
+static int
+sys_move_mount(int from_dirfd, const char *from_path, int to_dirfd, const char *to_path, unsigned int flags)
+{
+        ++nsyscalls;
+        return ((int)syscall(SYS_move_mount, from_dirfd, from_path, to_dirfd, to_path, flags));
+}
+
+static int
+sys_mount_setattr(int dirfd, const char *path, unsigned int flags, struct mount_attr *attr)
+{
+        ++nsyscalls;
+        return ((int)syscall(SYS_mount_setattr, dirfd, path, flags, attr, sizeof(*attr)));
+}
+
+static int
+sys_fsopen(const char *fsname, unsigned int flags)
+{
+        ++nsyscalls;
+        return ((int)syscall(SYS_fsopen, fsname, flags));
+}
+
+static int
+sys_fsconfig(int fd, unsigned int cmd, const char *key, const char *value, int aux)
+{
+        ++nsyscalls;
+        return ((int)syscall(SYS_fsconfig, fd, cmd, key, value, aux));
+}
+
+static int
+sys_fsmount(int fd, unsigned int flags, unsigned int attr_flags)
+{
+        ++nsyscalls;
+        return ((int)syscall(SYS_fsmount, fd, flags, attr_flags));
+}
+
+static int
+fsconfig_data(int fd, const char *data)
+{
+        char *buf, *next, *opt, *val;
+        int rv = -1;
+
+        if ((next = buf = strdup(data)) == NULL)
+                return (-1);
+        while ((opt = strsep(&next, ",")) != NULL) {
+                if (*opt == '\0')
+                        continue;
+                if ((val = strchr(opt, '=')) != NULL)
+                        *val++ = '\0';
+                if (sys_fsconfig(fd, val != NULL ? FSCONFIG_SET_STRING : FSCONFIG_SET_FLAG, opt, val, 0) < 0)
+                        goto err;
+        }
+        rv = 0;
+
+ err:
+        SAVE_ERRNO(free(buf));
+        return (rv);
+}
+
+static int
+lock_flags(const char *dst, const struct mntent *mnt, unsigned long *flags)
 {
         int userns;
         struct statvfs s;
@@ -439,22 +759,65 @@ mount_generic(const char *dst, const struct mntent *mnt, unsigned long flags, co
                 {ST_RELATIME, MS_RELATIME},
         };
 
-        if (hasmntopt(mnt, "x-detach"))
-                return (do_umount(dst, MNT_DETACH));
-
-        if (!hasmntopt(mnt, "rbind"))
-                flags &= (unsigned long)~MS_REC;
-
-        if ((flags & MS_REMOUNT) || (flags & MS_BIND)) {
+        /* Mount flags inherited from a more privileged user namespace are locked and need to be preserved. */
+        if ((*flags & MS_REMOUNT) || (*flags & MS_BIND)) {
                 if ((userns = detect_userns()) < 0)
                         return (-1);
-                if (userns && statvfs((flags & MS_REMOUNT) ? dst : mnt->mnt_fsname, &s) == 0) {
+                if (userns && statvfs((*flags & MS_REMOUNT) ? dst : mnt->mnt_fsname, &s) == 0) {
                         for (size_t i = 0; i < ARRAY_SIZE(s2mflag); ++i) {
                                 if (s.f_flag & s2mflag[i].sflag)
-                                        flags |= s2mflag[i].mflag;
+                                        *flags |= s2mflag[i].mflag;
                         }
                 }
         }
+        return (0);
+}
+
+static unsigned int
+propagation_rec(const struct mntent *mnt, unsigned long prop)
+{
+        for (size_t i = 0; i < ARRAY_SIZE(propagation); ++i) {
+                if ((prop & propagation[i].flag) && hasmntopt(mnt, propagation[i].ropt))
+                        return (AT_RECURSIVE);
+        }
+        return (0);
+}
+
+static uint64_t
+mount_attr_flags(unsigned long flags)
+{
+        uint64_t attr = MOUNT_ATTR_RELATIME;
+
+        if (flags & MS_RDONLY)
+                attr |= MOUNT_ATTR_RDONLY;
+        if (flags & MS_NOSUID)
+                attr |= MOUNT_ATTR_NOSUID;
+        if (flags & MS_NODEV)
+                attr |= MOUNT_ATTR_NODEV;
+        if (flags & MS_NOEXEC)
+                attr |= MOUNT_ATTR_NOEXEC;
+        if (flags & MS_NODIRATIME)
+                attr |= MOUNT_ATTR_NODIRATIME;
+
+        /* Same precedence as mount(2), strictatime overrides noatime. */
+        if (flags & MS_STRICTATIME)
+                attr |= MOUNT_ATTR_STRICTATIME;
+        else if (flags & MS_NOATIME)
+                attr |= MOUNT_ATTR_NOATIME;
+        return (attr);
+}
+
+static int
+mount_generic(const char *dst, const struct mntent *mnt, unsigned long flags, const char *data)
+{
+        if (hasmntopt(mnt, "x-detach"))
+                return (do_umount(dst, MNT_DETACH));
+
+        if (!hasmntopt(mnt, "rbind"))
+                flags &= (unsigned long)~MS_REC;
+
+        if (lock_flags(dst, mnt, &flags) < 0)
+                return (-1);
 
         if (do_mount(mnt->mnt_fsname, dst, mnt->mnt_type, flags, data) < 0)
                 return (-1);
@@ -472,13 +835,6 @@ mount_generic(const char *dst, const struct mntent *mnt, unsigned long flags, co
 static int
 mount_propagate(const char *dst, const struct mntent *mnt, unsigned long flags)
 {
-        const struct { unsigned long flag; const char *ropt; } propagation[] = {
-                {MS_SHARED, "rshared"},
-                {MS_SLAVE, "rslave"},
-                {MS_PRIVATE, "rprivate"},
-                {MS_UNBINDABLE, "runbindable"},
-        };
-
         for (size_t i = 0; i < ARRAY_SIZE(propagation); ++i) {
                 unsigned long tmp = flags;
 
@@ -492,41 +848,290 @@ mount_propagate(const char *dst, const struct mntent *mnt, unsigned long flags)
         return (0);
 }
 
-static void
-mount_entry(const char *root, const struct mntent *mnt)
+/*
+ * Perform bind mounts, bind remounts and propagation changes with the new mount API (Linux 5.12).
+ * The bind mount is cloned with open_tree(2), its attributes and propagation are applied with a single
+ * mount_setattr(2) before it gets attached with move_mount(2), and CAP_SYS_ADMIN is only raised once.
+ * With x-recursive-attr, the attributes given are added to every mount of the subtree instead of the topmost one.
+ * When assembling a detached tree (dirfd is not AT_FDCWD), new mounts are attached to it at dst relative to dirfd,
+ * filesystems are then also created through fsopen(2) and fsmount(2).
+ * Return -1 on error, 0 if the entry needs to go through mount(2) instead, 1 on success.
+ */
+static int
+mount_tree(int dirfd, const char *dst, const struct mntent *mnt, unsigned long flags, const char *data)
+{
+        const unsigned long mattrs = MS_RDONLY|MS_NOSUID|MS_NODEV|MS_NOEXEC|MS_NOATIME|MS_NODIRATIME|MS_RELATIME|MS_STRICTATIME;
+        struct mount_attr attr = {0};
+        unsigned long prop = flags & MS_PROPAGATION;
+        unsigned int recprop, recattr, setflags;
+        bool bind, remount, fsmnt, hasattr;
+        int fd = -1, fsfd = -1;
+
+        recattr = hasmntopt(mnt, "x-recursive-attr") ? AT_RECURSIVE : 0;
+        if (!mount_api_supported || (!mount_api && !recattr && dirfd == AT_FDCWD))
+                return (0);
+
+        flags &= ~(MS_PROPAGATION|MS_REC|MS_SILENT);
+        bind = (flags & (MS_BIND|MS_REMOUNT)) == MS_BIND;
+        remount = (flags & (MS_BIND|MS_REMOUNT)) == (MS_BIND|MS_REMOUNT);
+        fsmnt = !strnull(mnt->mnt_type) && strcmp(mnt->mnt_type, "none");
+
+        /* Filesystem mounts outside of detached trees, moves, detaches and bind mount data are left to mount(2). */
+        if (fsmnt && (dirfd == AT_FDCWD || (flags & (MS_BIND|MS_REMOUNT))))
+                return (0);
+        if (!fsmnt && !strnull(data))
+                return (0);
+        if (hasmntopt(mnt, "x-detach") || (flags & ~(mattrs|MS_BIND|MS_REMOUNT)) || (prop & (prop - 1)))
+                return (0);
+        if (!fsmnt && !bind) {
+                /* Only new mounts can be attached to detached trees. */
+                if (dirfd != AT_FDCWD)
+                        return (0);
+                if (!remount && (flags != 0 || prop == 0))
+                        return (0);
+        }
+
+        if (fsmnt) {
+                attr.attr_set = mount_attr_flags(flags);
+        } else if (recattr) {
+                /*
+                 * Only set the attributes requested and leave the others alone, submounts can have different
+                 * (possibly locked) attributes which we don't want to clear.
+                 */
+                attr.attr_set = mount_attr_flags(flags);
+                if (flags & (MS_NOATIME|MS_STRICTATIME|MS_RELATIME))
+                        attr.attr_clr = MOUNT_ATTR__ATIME;
+                else
+                        attr.attr_set &= ~(uint64_t)MOUNT_ATTR__ATIME;
+        } else {
+                if (lock_flags(dst, mnt, &flags) < 0)
+                        return (-1);
+                if (remount || (flags & (unsigned long)~MS_BIND)) {
+                        attr.attr_set = mount_attr_flags(flags);
+                        attr.attr_clr = MOUNT_ATTR_RDONLY|MOUNT_ATTR_NOSUID|MOUNT_ATTR_NODEV|MOUNT_ATTR_NOEXEC|MOUNT_ATTR__ATIME|MOUNT_ATTR_NODIRATIME;
+                }
+        }
+        hasattr = !fsmnt && (attr.attr_set != 0 || attr.attr_clr != 0);
+        recprop = propagation_rec(mnt, prop);
+
+        /*
+         * Mount attributes only apply to the topmost mount unless x-recursive-attr is given, so propagation
+         * can only be folded in the same call if there are no attributes to change or if both are equally recursive.
+         */
+        if (prop != 0 && (!hasattr || recprop == recattr)) {
+                attr.propagation = prop;
+                prop = 0;
+        }
+        setflags = hasattr ? recattr : recprop;
+
+        if (set_sysadmin(true) < 0)
+                return (-1);
+
+        if (bind) {
+                if ((fd = sys_open_tree(AT_FDCWD, mnt->mnt_fsname, OPEN_TREE_CLONE|OPEN_TREE_CLOEXEC|
+                    (hasmntopt(mnt, "rbind") ? AT_RECURSIVE : 0))) < 0)
+                        goto err;
+        } else if (fsmnt) {
+                if ((fsfd = sys_fsopen(mnt->mnt_type, FSOPEN_CLOEXEC)) < 0)
+                        goto err;
+                if (sys_fsconfig(fsfd, FSCONFIG_SET_STRING, "source", mnt->mnt_fsname, 0) < 0)
+                        goto err;
+                if (fsconfig_data(fsfd, data) < 0)
+                        goto err;
+                if (sys_fsconfig(fsfd, FSCONFIG_CMD_CREATE, NULL, NULL, 0) < 0)
+                        goto err;
+                if ((fd = sys_fsmount(fsfd, FSMOUNT_CLOEXEC, (unsigned int)attr.attr_set)) < 0)
+                        goto err;
+                if (close(fsfd) < 0)
+                        goto err;
+                fsfd = -1;
+        }
+        if (hasattr || attr.propagation != 0) {
+                if (sys_mount_setattr(fd >= 0 ? fd : dirfd, fd >= 0 ? "" : dst,
+                    (fd >= 0 ? AT_EMPTY_PATH : 0)|setflags, &attr) < 0)
+                        goto err;
+        }
+        if (fd >= 0) {
+                if (sys_move_mount(fd, "", dirfd, dst, MOVE_MOUNT_F_EMPTY_PATH) < 0)
+                        goto err;
+                if (close(fd) < 0)
+                        goto err;
+                fd = -1;
+        }
+        if (prop != 0) {
+                attr = (struct mount_attr){.propagation = prop};
+                if (sys_mount_setattr(dirfd, dst, recprop, &attr) < 0)
+                        goto err;
+        }
+
+        if (set_sysadmin(false) < 0)
+                return (-1);
+        return (1);
+
+ err:
+        SAVE_ERRNO(close(fsfd));
+        SAVE_ERRNO(close(fd));
+        SAVE_ERRNO(set_sysadmin(false));
+
+        /* Older kernels lack support for the new mount API, nothing has been attached at this point. */
+        if (errno == ENOSYS) {
+                warnxdbg("new mount API unavailable, falling back to mount(2)");
+                mount_api_supported = false;
+                return (0);
+        }
+        return (-1);
+}
+
+/*
+ * Attach the detached tree assembled from x-tree entries on top of the root directory with a single move_mount(2).
+ * Propagation can't be changed on detached mounts, so it gets applied to each of them once attached.
+ */
+static int
+tree_attach(void)
+{
+        struct mount_attr attr = {0};
+        int rv = 0;
+
+        if (tree.fd < 0)
+                return (0);
+
+        if (tree.ntargets > 0) {
+                if ((rv = set_sysadmin(true)) < 0)
+                        goto err;
+                if ((rv = sys_move_mount(tree.fd, "", AT_FDCWD, tree.root, MOVE_MOUNT_F_EMPTY_PATH)) < 0)
+                        goto err;
+                for (size_t i = 0; i < tree.ntargets; ++i) {
+                        if (tree.targets[i].prop == 0)
+                                continue;
+                        attr.propagation = tree.targets[i].prop;
+                        if ((rv = sys_mount_setattr(AT_FDCWD, tree.targets[i].path, tree.targets[i].recprop, &attr)) < 0)
+                                goto err;
+                }
+                warnxdbg("%s: attached %zu mounts at once", tree.root, tree.ntargets);
+        }
+
+ err:
+        if (tree.ntargets > 0)
+                SAVE_ERRNO(set_sysadmin(false));
+        SAVE_ERRNO(close(tree.fd));
+        tree.fd = -1;
+
+        for (size_t i = 0; i < tree.ntargets; ++i)
+                free(tree.targets[i].path);
+        free(tree.targets);
+        tree.targets = NULL;
+        tree.ntargets = 0;
+        return (rv);
+}
+
+/*
+ * Check whether a path goes through one of the mounts of the pending tree, in which case it needs to be attached first.
+ */
+static bool
+tree_depends(const char *path)
+{
+        size_t len;
+
+        for (size_t i = 0; i < tree.ntargets; ++i) {
+                len = strlen(tree.targets[i].path);
+                if (!strncmp(path, tree.targets[i].path, len) && (path[len] == '\0' || path[len] == '/'))
+                        return (true);
+        }
+        return (false);
+}
+
+/*
+ * Mount an x-tree entry on the detached tree, creating the latter from a copy of the root directory if needed.
+ * Return -1 on error, 0 if the entry needs to be mounted directly instead, 1 on success.
+ */
+static int
+tree_mount(const char *root, const char *path, const struct mntent *mnt, unsigned long flags, const char *data)
+{
+        void *targets;
+        char *target;
+        unsigned long prop = flags & MS_PROPAGATION;
+        int rv;
+
+        if (tree.fd < 0) {
+                if (realpath(root, tree.root) == NULL)
+                        return (-1);
+                if ((tree.rootlen = strlen(tree.root)) == 1)
+                        return (0);
+                if (set_sysadmin(true) < 0)
+                        return (-1);
+                tree.fd = sys_open_tree(AT_FDCWD, tree.root, OPEN_TREE_CLONE|OPEN_TREE_CLOEXEC|AT_RECURSIVE);
+                SAVE_ERRNO(set_sysadmin(false));
+                if (tree.fd < 0) {
+                        if (errno != ENOSYS)
+                                return (-1);
+                        tree.unsupported = true;
+                        return (0);
+                }
+        }
+        if (strncmp(path, tree.root, tree.rootlen) || path[tree.rootlen] != '/')
+                return (0);
+
+        if ((targets = realloc(tree.targets, (tree.ntargets + 1) * sizeof(*tree.targets))) == NULL)
+                return (-1);
+        tree.targets = targets;
+        if ((target = strdup(path)) == NULL)
+                return (-1);
+
+        if ((rv = mount_tree(tree.fd, path + tree.rootlen + 1, mnt, flags & ~MS_PROPAGATION, data)) == 1) {
+                tree.targets[tree.ntargets].path = target;
+                tree.targets[tree.ntargets].prop = prop;
+                tree.targets[tree.ntargets++].recprop = propagation_rec(mnt, prop);
+        } else
+                SAVE_ERRNO(free(target));
+
+        /* Mounting on detached trees requires Linux 6.15, fallback to regular mounts if the first one fails. */
+        if (rv < 0 && errno == EINVAL && tree.ntargets == 0) {
+                warnxdbg("detached mount trees unavailable, falling back to regular mounts");
+                tree.unsupported = true;
+                close(tree.fd);
+                tree.fd = -1;
+                return (0);
+        }
+        return (rv);
+}
+
+/*
+ * Return 0 on success, 1 if the entry failed but was marked nofail, -1 on error.
+ */
+static int
+mount_entry(const char *root, const struct mount_spec *spec)
 {
         int rv = -1;
         bool fatal, verbose;
         char path[PATH_MAX];
         char errmsg[256 + PATH_MAX] = {0};
-        char *data = NULL;
-        unsigned long flags = 0;
+        const struct mntent *mnt = &spec->mnt;
+        const char *data = spec->data;
+        unsigned long flags = spec->flags;
         struct stat s;
-        mode_t mode = 0;
+        mode_t mode = spec->create;
+        const char *backend = "mount";
+        bool intree;
 
+        nsyscalls = 0;
         fatal = !hasmntopt(mnt, "nofail");
         verbose = !hasmntopt(mnt, "silent") || hasmntopt(mnt, "loud");
-
-        if (realpathat(root, mnt->mnt_dir, path) < 0) {
-                SAVE_ERRNO(snprintf(errmsg, sizeof(errmsg), "failed to resolve path: %s%s%s",
-                    root, (*mnt->mnt_dir == '/') ? "" : "/", mnt->mnt_dir));
-                goto err;
-        }
-        if (parse_mount_opts(mnt->mnt_opts, &data, &flags) < 0) {
-                SAVE_ERRNO(snprintf(errmsg, sizeof(errmsg), "failed to parse mount entry"));
-                goto err;
+        intree = hasmntopt(mnt, "x-tree") && !tree.unsupported;
+
+        if (!intree && tree_attach() < 0)
+                goto err_attach;
+        if (realpathat(root, mnt->mnt_dir, path) < 0)
+                goto err_resolve;
+        if (intree && tree_depends(path)) {
+                if (tree_attach() < 0)
+                        goto err_attach;
+                if (realpathat(root, mnt->mnt_dir, path) < 0)
+                        goto err_resolve;
         }
 
-        if (hasmntopt(mnt, "x-create=file"))
-                mode |= S_IFREG;
-        else if (hasmntopt(mnt, "x-create=dir"))
-                mode |= S_IFDIR;
-        else if (hasmntopt(mnt, "x-create=auto")) {
-                if (!(flags & MS_BIND))
-                        mode |= S_IFDIR;
-                else if (stat(mnt->mnt_fsname, &s) == 0)
-                        mode |= S_ISDIR(s.st_mode) ? S_IFDIR : S_IFREG;
-        }
+        /* Bind mounts with x-create=auto depend on the source type at the time of the mount. */
+        if (mode == S_IFMT)
+                mode = stat(mnt->mnt_fsname, &s) == 0 ? (S_ISDIR(s.st_mode) ? S_IFDIR : S_IFREG) : 0;
         if (mode != 0) {
                 if (create_file(path, mode) < 0) {
                         SAVE_ERRNO(snprintf(errmsg, sizeof(errmsg), "failed to create %s: %s",
@@ -535,45 +1140,66 @@ mount_entry(const char *root, const struct mntent *mnt)
                 }
         }
 
-        if ((!strnull(mnt->mnt_type) && strcmp(mnt->mnt_type, "none")) || flags & ~(MS_PROPAGATION|MS_REC|MS_SILENT)) {
-                if (mount_generic(path, mnt, flags & ~MS_PROPAGATION, data) < 0) {
-                        SAVE_ERRNO(snprintf(errmsg, sizeof(errmsg), "failed to %smount: %s at %s",
-                            hasmntopt(mnt, "x-detach") ? "un" : "", mnt->mnt_fsname, path));
-                        goto err;
-                }
-        }
-        if (flags & MS_PROPAGATION) {
-                if (mount_propagate(path, mnt, flags & (MS_PROPAGATION|MS_REC|MS_SILENT)) < 0) {
+        switch (intree ? tree_mount(root, path, mnt, flags, data) : mount_tree(AT_FDCWD, path, mnt, flags, data)) {
+        case -1:
+                if (flags & ~(MS_PROPAGATION|MS_REC|MS_SILENT))
+                        SAVE_ERRNO(snprintf(errmsg, sizeof(errmsg), "failed to mount: %s at %s", mnt->mnt_fsname, path));
+                else
                         SAVE_ERRNO(snprintf(errmsg, sizeof(errmsg), "failed to set mount propagation: %s", path));
-                        goto err;
+                goto err;
+        case 1:
+                backend = intree ? "tree" : "mount_setattr";
+                break;
+        case 0:
+                if (tree_attach() < 0)
+                        goto err_attach;
+                if ((!strnull(mnt->mnt_type) && strcmp(mnt->mnt_type, "none")) || flags & ~(MS_PROPAGATION|MS_REC|MS_SILENT)) {
+                        if (mount_generic(path, mnt, flags & ~MS_PROPAGATION, data) < 0) {
+                                SAVE_ERRNO(snprintf(errmsg, sizeof(errmsg), "failed to %smount: %s at %s",
+                                    hasmntopt(mnt, "x-detach") ? "un" : "", mnt->mnt_fsname, path));
+                                goto err;
+                        }
+                }
+                if (flags & MS_PROPAGATION) {
+                        if (mount_propagate(path, mnt, flags & (MS_PROPAGATION|MS_REC|MS_SILENT)) < 0) {
+                                SAVE_ERRNO(snprintf(errmsg, sizeof(errmsg), "failed to set mount propagation: %s", path));
+                                goto err;
+                        }
                 }
+                break;
         }
         rv = 0;
-
+        goto err;
+
+ err_resolve:
+        SAVE_ERRNO(snprintf(errmsg, sizeof(errmsg), "failed to resolve path: %s%s%s",
+            root, (*mnt->mnt_dir == '/') ? "" : "/", mnt->mnt_dir));
+        goto err;
+ err_attach:
+        SAVE_ERRNO(snprintf(errmsg, sizeof(errmsg), "failed to attach mount tree: %s", tree.root));
  err:
-        free(data);
+        warnxdbg("%s: %u mount syscalls (%s)", mnt->mnt_dir, nsyscalls, backend);
         if (rv < 0) {
-                if (fatal)
-                        err(EXIT_FAILURE, "%s", errmsg);
-                if (verbose)
-                        warn("%s", errmsg);
+                if (fatal || verbose)
+                        SAVE_ERRNO(warn("%s", errmsg));
+                if (!fatal)
+                        rv = 1;
         }
+        return (rv);
 }
 
-static void
-mount_fstab(const char *root, const char *fstab, int passno)
+/*
+ * Read the next fstab entry of a given pass (or any pass if passno is NULL), filling in its missing components.
+ * Return 1 if an entry was read, 0 on EOF, -1 if the entry is invalid.
+ */
+static int
+next_entry(FILE *fs, const char *name, const int *passno, struct mntent *mnt, char *buf, size_t size)
 {
-        FILE *fs;
-        struct mntent mnt;
-        char buf[FSTAB_LINE_MAX];
-
-        if ((fs = setmntent(fstab, "r")) == NULL)
-                err(EXIT_FAILURE, "failed to open: %s", fstab);
-        while (compat_getmntent_r(fs, &mnt, buf, sizeof(buf)) != NULL) {
+        while (compat_getmntent_r(fs, mnt, buf, (int)size) != NULL) {
                 /* Use fs_freq as fs_passno if it wasn't specified. */
-                if (mnt.mnt_freq != 0 && mnt.mnt_passno == 0)
-                        mnt.mnt_passno = mnt.mnt_freq;
-                if (passno != mnt.mnt_passno)
+                if (mnt->mnt_freq != 0 && mnt->mnt_passno == 0)
+                        mnt->mnt_passno = mnt->mnt_freq;
+                if (passno != NULL && *passno != mnt->mnt_passno)
                         continue;
 
                 /* Try to guess the mount entry if it's missing components, for example
@@ -584,48 +1210,317 @@ mount_fstab(const char *root, const char *fstab, int passno)
                  * /src  /dst bind   -> /src  /dst none   bind
                  * none  /dst devpts -> none  /dst devpts ""
                  */
-                if (!strnull(mnt.mnt_dir) && strnull(mnt.mnt_type) && strnull(mnt.mnt_opts) && ismntopt(mnt.mnt_dir)) {
-                        mnt.mnt_opts = mnt.mnt_dir;
-                        mnt.mnt_type = (char *)"none";
-                        mnt.mnt_dir = (char *)"";
+                if (!strnull(mnt->mnt_dir) && strnull(mnt->mnt_type) && strnull(mnt->mnt_opts) && ismntopt(mnt->mnt_dir)) {
+                        mnt->mnt_opts = mnt->mnt_dir;
+                        mnt->mnt_type = (char *)"none";
+                        mnt->mnt_dir = (char *)"";
                 }
-                if (!strnull(mnt.mnt_type) && strnull(mnt.mnt_opts) && ismntopt(mnt.mnt_type)) {
-                        mnt.mnt_opts = mnt.mnt_type;
-                        mnt.mnt_type = (char *)"none";
-                        if (!strcmp(mnt.mnt_dir, "none"))
-                                mnt.mnt_dir = (char *)"";
+                if (!strnull(mnt->mnt_type) && strnull(mnt->mnt_opts) && ismntopt(mnt->mnt_type)) {
+                        mnt->mnt_opts = mnt->mnt_type;
+                        mnt->mnt_type = (char *)"none";
+                        if (!strcmp(mnt->mnt_dir, "none"))
+                                mnt->mnt_dir = (char *)"";
                 }
-                if (!strnull(mnt.mnt_fsname)) {
-                        if (!strcmp(mnt.mnt_fsname, "tmpfs")) {
-                                if (strnull(mnt.mnt_type) || !strcmp(mnt.mnt_type, "none"))
-                                        mnt.mnt_type = (char *)"tmpfs";
+                if (!strnull(mnt->mnt_fsname)) {
+                        if (!strcmp(mnt->mnt_fsname, "tmpfs")) {
+                                if (strnull(mnt->mnt_type) || !strcmp(mnt->mnt_type, "none"))
+                                        mnt->mnt_type = (char *)"tmpfs";
                         } else {
-                                if (strnull(mnt.mnt_dir))
-                                        mnt.mnt_dir = mnt.mnt_fsname;
-                                if (strnull(mnt.mnt_type) || !strcmp(mnt.mnt_type, "none")) {
-                                        mnt.mnt_type = (char *)"none";
-                                        if (strnull(mnt.mnt_opts))
-                                                mnt.mnt_opts = (char *)"rbind,x-create=auto";
+                                if (strnull(mnt->mnt_dir))
+                                        mnt->mnt_dir = mnt->mnt_fsname;
+                                if (strnull(mnt->mnt_type) || !strcmp(mnt->mnt_type, "none")) {
+                                        mnt->mnt_type = (char *)"none";
+                                        if (strnull(mnt->mnt_opts))
+                                                mnt->mnt_opts = (char *)"rbind,x-create=auto";
                                 }
                         }
                 }
-                if (mnt.mnt_opts == NULL)
-                        mnt.mnt_opts = (char *)"";
-                if (strnull(mnt.mnt_fsname) || strnull(mnt.mnt_dir) || strnull(mnt.mnt_type))
-                        errx(EXIT_FAILURE, "invalid fstab entry: \"%s\" at %s", buf, fstab);
+                if (mnt->mnt_opts == NULL)
+                        mnt->mnt_opts = (char *)"";
+                if (strnull(mnt->mnt_fsname) || strnull(mnt->mnt_dir) || strnull(mnt->mnt_type)) {
+                        warnx("invalid fstab entry: \"%s\" at %s", buf, name);
+                        errno = EINVAL;
+                        return (-1);
+                }
+                return (1);
+        }
+        return (0);
+}
 
-                mount_entry(root, &mnt);
+static int
+parse_spec(struct mount_spec *spec)
+{
+        const struct mntent *mnt = &spec->mnt;
+
+        if (parse_mount_opts(mnt->mnt_opts, &spec->data, &spec->flags) < 0)
+                return (-1);
+
+        spec->create = 0;
+        if (hasmntopt(mnt, "x-create=file"))
+                spec->create = S_IFREG;
+        else if (hasmntopt(mnt, "x-create=dir"))
+                spec->create = S_IFDIR;
+        else if (hasmntopt(mnt, "x-create=auto"))
+                spec->create = (spec->flags & MS_BIND) ? S_IFMT : S_IFDIR;
+        return (0);
+}
+
+static void
+report_status(FILE *status, int rv, const char *target)
+{
+        if (status != NULL)
+                fprintf(status, "%s %d %s\n", rv == 0 ? "ok" : rv > 0 ? "ignored" : "failed", rv == 0 ? 0 : errno, target);
+}
+
+static int
+mount_attach_tree(FILE *status)
+{
+        if (tree_attach() < 0) {
+                SAVE_ERRNO(warn("failed to attach mount tree: %s", tree.root));
+                report_status(status, -1, tree.root);
+                return (-1);
         }
+        return (0);
+}
+
+/*
+ * Mount all the entries of a given pass from an fstab stream, stopping at the first error.
+ * If status is not NULL, the outcome of each entry is reported to it as "ok|ignored|failed ERRNO TARGET".
+ */
+static int
+mount_stream(const char *root, FILE *fs, const char *name, int passno, FILE *status)
+{
+        struct mount_spec spec;
+        char buf[FSTAB_LINE_MAX];
+        int rv;
+
+        while ((rv = next_entry(fs, name, &passno, &spec.mnt, buf, sizeof(buf))) != 0) {
+                if (rv < 0) {
+                        report_status(status, rv, strnull(spec.mnt.mnt_dir) ? "-" : spec.mnt.mnt_dir);
+                        goto err;
+                }
+                if (parse_spec(&spec) < 0) {
+                        warn("failed to parse mount entry");
+                        report_status(status, -1, spec.mnt.mnt_dir);
+                        goto err;
+                }
+                rv = mount_entry(root, &spec);
+                free(spec.data);
+                report_status(status, rv, spec.mnt.mnt_dir);
+                if (rv < 0)
+                        goto err;
+        }
+        return (mount_attach_tree(status));
+
+ err:
+        SAVE_ERRNO(mount_attach_tree(status));
+        return (-1);
+}
+
+static void
+mount_fstab(const char *root, const char *fstab, int passno)
+{
+        FILE *fs;
+
+        if ((fs = setmntent(fstab, "r")) == NULL)
+                err(EXIT_FAILURE, "failed to open: %s", fstab);
+        if (mount_stream(root, fs, fstab, passno, NULL) < 0)
+                exit(EXIT_FAILURE);
         endmntent(fs);
 }
 
+/*
+ * Compile fstab files into a mount plan, where every entry is stored already normalized along with its parsed
+ * options so that it can be executed without going through the fstab parsing again.
+ */
+static void
+compile_plan(const char *plan, char *fstabs[], int n)
+{
+        FILE *fs, *out;
+        struct mount_spec spec;
+        struct plan_entry ent;
+        char buf[FSTAB_LINE_MAX];
+        const char *strs[5];
+        int rv;
+
+        if ((out = fopen(plan, "we")) == NULL)
+                err(EXIT_FAILURE, "failed to open: %s", plan);
+        if (fwrite(PLAN_MAGIC, sizeof(PLAN_MAGIC) - 1, 1, out) != 1)
+                goto err;
+
+        for (int i = 0; i < n; ++i) {
+                if ((fs = setmntent(strcmp(fstabs[i], "-") ? fstabs[i] : "/proc/self/fd/0", "r")) == NULL)
+                        err(EXIT_FAILURE, "failed to open: %s", fstabs[i]);
+                while ((rv = next_entry(fs, fstabs[i], NULL, &spec.mnt, buf, sizeof(buf))) != 0) {
+                        if (rv < 0)
+                                exit(EXIT_FAILURE);
+                        if (parse_spec(&spec) < 0)
+                                err(EXIT_FAILURE, "failed to parse mount entry");
+
+                        strs[0] = spec.mnt.mnt_fsname;
+                        strs[1] = spec.mnt.mnt_dir;
+                        strs[2] = spec.mnt.mnt_type;
+                        strs[3] = spec.mnt.mnt_opts;
+                        strs[4] = spec.data;
+
+                        ent = (struct plan_entry){
+                                .passno = spec.mnt.mnt_passno,
+                                .create = spec.create,
+                                .flags = spec.flags,
+                        };
+                        for (size_t j = 0; j < ARRAY_SIZE(strs); ++j)
+                                ent.size += (uint32_t)strlen(strs[j]) + 1;
+                        if (fwrite(&ent, sizeof(ent), 1, out) != 1)
+                                goto err;
+                        for (size_t j = 0; j < ARRAY_SIZE(strs); ++j) {
+                                if (fwrite(strs[j], strlen(strs[j]) + 1, 1, out) != 1)
+                                        goto err;
+                        }
+                        free(spec.data);
+                }
+                endmntent(fs);
+        }
+        if (fclose(out) < 0)
+                err(EXIT_FAILURE, "failed to write: %s", plan);
+        return;
+
+ err:
+        err(EXIT_FAILURE, "failed to write: %s", plan);
+}
+
+/*
+ * Mount all the entries of a given pass from a mount plan, stopping at the first error.
+ */
+static int
+mount_plan(const char *root, const char *plan, int passno, FILE *status)
+{
+        FILE *fs;
+        struct stat s;
+        struct mount_spec spec;
+        struct plan_entry ent;
+        char *buf = NULL, *ptr, *end;
+        char **strs[] = {&spec.mnt.mnt_fsname, &spec.mnt.mnt_dir, &spec.mnt.mnt_type, &spec.mnt.mnt_opts, &spec.data};
+        int rv = -1;
+
+        if ((fs = fopen(plan, "re")) == NULL)
+                goto err;
+        if (fstat(fileno(fs), &s) < 0)
+                goto err;
+        if ((buf = malloc((size_t)s.st_size + 1)) == NULL)
+                goto err;
+        if (fread(buf, 1, (size_t)s.st_size, fs) != (size_t)s.st_size)
+                goto err;
+
+        errno = EINVAL;
+        if ((size_t)s.st_size < sizeof(PLAN_MAGIC) - 1 || memcmp(buf, PLAN_MAGIC, sizeof(PLAN_MAGIC) - 1))
+                goto err;
+
+        end = buf + s.st_size;
+        for (ptr = buf + sizeof(PLAN_MAGIC) - 1; ptr < end; ptr += ent.size) {
+                errno = EINVAL;
+                if ((size_t)(end - ptr) < sizeof(ent))
+                        goto err;
+                memcpy(&ent, ptr, sizeof(ent));
+                ptr += sizeof(ent);
+                if ((size_t)(end - ptr) < ent.size || ent.size == 0 || ptr[ent.size - 1] != '\0')
+                        goto err;
+                if (ent.passno != passno)
+                        continue;
+
+                spec = (struct mount_spec){
+                        .mnt.mnt_passno = ent.passno,
+                        .flags = (unsigned long)ent.flags,
+                        .create = ent.create,
+                };
+                *strs[0] = ptr;
+                for (size_t i = 1; i < ARRAY_SIZE(strs); ++i) {
+                        /* The entry is NUL-terminated so this can't go past it. */
+                        *strs[i] = memchr(*strs[i - 1], '\0', ent.size);
+                        if (*strs[i] >= ptr + ent.size - 1)
+                                goto err;
+                        ++*strs[i];
+                }
+
+                rv = mount_entry(root, &spec);
+                report_status(status, rv, spec.mnt.mnt_dir);
+                if (rv < 0)
+                        goto out;
+        }
+        rv = 0;
+        goto out;
+
+ err:
+        SAVE_ERRNO(warn("failed to read mount plan: %s", plan));
+        report_status(status, -1, "-");
+ out:
+        if (mount_attach_tree(status) < 0)
+                rv = -1;
+        if (fs != NULL)
+                SAVE_ERRNO(fclose(fs));
+        free(buf);
+        return (rv);
+}
+
+/*
+ * Serve mount requests from stdin until EOF, so that callers mounting several fstabs only pay for the
+ * process startup and capability setup once. Each request is made of four NUL-terminated fields:
+ *   ROOT \0 PASSNO \0 PLAN \0 FSTAB \0
+ * The mount plan is optional and executed first if given.
+ * The status of every entry processed is written to stdout, followed by a NUL byte once the request completes.
+ */
+static void
+mount_serve(void)
+{
+        FILE *fs;
+        char *root = NULL, *pass = NULL, *plan = NULL, *fstab = NULL;
+        size_t rsize = 0, psize = 0, lsize = 0, fsize = 0;
+        ssize_t len;
+        int e, passno;
+
+        while (getdelim(&root, &rsize, '\0', stdin) >= 0) {
+                if (getdelim(&pass, &psize, '\0', stdin) < 0 || getdelim(&plan, &lsize, '\0', stdin) < 0 ||
+                    (len = getdelim(&fstab, &fsize, '\0', stdin)) < 0)
+                        errx(EXIT_FAILURE, "truncated mount request");
+                if (fstab[len - 1] == '\0')
+                        --len;
+
+                passno = (int)strtoi(pass, NULL, 10, INT_MIN, INT_MAX, &e);
+                if (e != 0) {
+                        warnx("invalid argument: %s", pass);
+                        printf("failed %d -\n", EINVAL);
+                } else if (strnull(plan) || mount_plan(root, plan, passno, stdout) == 0) {
+                        if (len > 0) {
+                                if ((fs = fmemopen(fstab, (size_t)len, "r")) == NULL)
+                                        err(EXIT_FAILURE, "failed to read mount request");
+                                mount_stream(root, fs, "<stdin>", passno, stdout);
+                                fclose(fs);
+                        }
+                }
+                if (putchar('\0') == EOF || fflush(stdout) == EOF)
+                        err(EXIT_FAILURE, "failed to write mount status");
+        }
+        if (ferror(stdin))
+                err(EXIT_FAILURE, "failed to read mount request");
+
+        free(root);
+        free(pass);
+        free(plan);
+        free(fstab);
+}
+
 int
 main(int argc, char *argv[])
 {
-        const char *root = "/";
+        const char *root = "/", *plan = NULL, *compile = NULL;
         int e, passno = 0;
+        bool serve = false;
 
         for (;;) {
+                if (argc >= 2 && !strcmp(argv[1], "--serve")) {
+                        serve = true;
+                        SHIFT_ARGS(1);
+                        continue;
+                }
                 if (argc >= 3 && !strcmp(argv[1], "--root")) {
                         root = argv[2];
                         SHIFT_ARGS(2);
@@ -638,15 +1533,42 @@ main(int argc, char *argv[])
                         SHIFT_ARGS(2);
                         continue;
                 }
+                if (argc >= 3 && !strcmp(argv[1], "--plan")) {
+                        plan = argv[2];
+                        SHIFT_ARGS(2);
+                        continue;
+                }
+                if (argc >= 3 && !strcmp(argv[1], "--compile")) {
+                        compile = argv[2];
+                        SHIFT_ARGS(2);
+                        continue;
+                }
                 break;
         }
-        if (argc < 2) {
-                printf("Usage: %s [--root DIR] [--pass NUM] FSTAB...\n", argv[0]);
+        if (argc < 2 && !serve && plan == NULL) {
+                printf("Usage: %s [--root DIR] [--pass NUM] [--plan FILE] FSTAB...\n", argv[0]);
+                printf("       %s --compile FILE FSTAB...\n", argv[0]);
+                printf("       %s --serve\n", argv[0]);
                 return (0);
         }
 
+        if (compile != NULL) {
+                compile_plan(compile, argv + 1, argc - 1);
+                return (0);
+        }
+
+        /* Use the new mount API if requested and supported by the kernel. */
+        if (getenv("ENROOT_NEW_MOUNT_API") != NULL)
+                mount_api = true;
+
         init_capabilities();
 
+        if (serve) {
+                mount_serve();
+                return (0);
+        }
+        if (plan != NULL && mount_plan(root, plan, passno, NULL) < 0)
+                exit(EXIT_FAILURE);
         if (argc == 2 && !strcmp(argv[1], "-"))
                 mount_fstab(root, "/proc/self/fd/0", passno);
         else {
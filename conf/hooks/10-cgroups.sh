@@ -30,4 +30,4 @@ while IFS=':' read -r x ctrl path; do
     fi
 done < /proc/self/cgroup
 
-printf "none /sys/fs/cgroup none rbind,remount,nosuid,noexec,nodev,ro,rslave,nofail,silent\n" >> "${ENROOT_MOUNTS}"
+printf "none /sys/fs/cgroup none rbind,remount,nosuid,noexec,nodev,ro,rslave,x-recursive-attr,nofail,silent\n" >> "${ENROOT_MOUNTS}"
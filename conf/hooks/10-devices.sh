@@ -22,7 +22,7 @@ fi
 
 source "${ENROOT_LIBRARY_PATH}/common.sh"
 
-cat << EOF | enroot-mount --root "${ENROOT_ROOTFS}" -
+cat << EOF | common::mount --root "${ENROOT_ROOTFS}" -
 none                    /dev            none    x-detach,nofail,silent
 tmpfs                   /dev            tmpfs   x-create=dir,rw,nosuid,noexec,mode=755,slave
 /dev/zero               /dev/zero       none    x-create=file,bind,rw,nosuid,noexec,private
@@ -35,26 +35,26 @@ devpts                  /dev/pts        devpts  x-create=dir,rw,nosuid,noexec,ne
 EOF
 
 if [ -n "${ENROOT_UNSHARE_IPC-}" ]; then
-    cat << EOF | enroot-mount --root "${ENROOT_ROOTFS}" -
+    cat << EOF | common::mount --root "${ENROOT_ROOTFS}" -
 none                    /dev/shm        none    x-create=dir,x-detach,nofail,silent
 tmpfs                   /dev/shm        tmpfs   x-create=dir,rw,nosuid,noexec,nodev,mode=1777,private
 none                    /dev/mqueue     none    x-create=dir,x-detach,nofail,silent
 mqueue                  /dev/mqueue     mqueue  x-create=dir,rw,nosuid,noexec,nodev,private,nofail,silent
 EOF
 else
-    cat << EOF | enroot-mount --root "${ENROOT_ROOTFS}" -
+    cat << EOF | common::mount --root "${ENROOT_ROOTFS}" -
 /dev/shm                /dev/shm        none    x-create=dir,bind,rw,nosuid,noexec,nodev,rslave
 /dev/mqueue             /dev/mqueue     none    x-create=dir,bind,rw,nosuid,noexec,nodev,rslave
 EOF
 fi
 
-cat << EOF | enroot-mount --root "${ENROOT_ROOTFS}" -
+cat << EOF | common::mount --root "${ENROOT_ROOTFS}" -
 /dev/hugepages          /dev/hugepages  none    x-create=dir,bind,rw,nosuid,noexec,nodev,rslave,nofail,silent
 /dev/log                /dev/log        none    x-create=file,bind,rw,nosuid,noexec,nodev,private
 EOF
 
 if [ -t 0 ]; then
-    enroot-mount --root "${ENROOT_ROOTFS}" - <<< "$(common::realpath /dev/stdin) /dev/console none x-create=file,bind,rw,nosuid,noexec,private"
+    common::mount --root "${ENROOT_ROOTFS}" - <<< "$(common::realpath /dev/stdin) /dev/console none x-create=file,bind,rw,nosuid,noexec,private"
 fi
 
 ln -s "/proc/self/fd" "${ENROOT_ROOTFS}/dev/fd"
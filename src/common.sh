@@ -274,3 +274,33 @@ common::mountpoint() {
     done
     printf "%s" "${path:-/}"
 }
+
+common::mount() {
+    local root="/" pass=0 plan="" fstab="" status="" wfd= rfd=
+
+    # Forward the request to the mount server if one was started, otherwise run enroot-mount directly.
+    if [ -z "${ENROOT_MOUNT_FD-}" ]; then
+        enroot-mount "$@"
+        return
+    fi
+    read -r wfd rfd <<< "${ENROOT_MOUNT_FD}"
+
+    while [ $# -gt 0 ]; do
+        case "$1" in
+        --root)
+            root="$2"; shift 2 ;;
+        --pass)
+            pass="$2"; shift 2 ;;
+        --plan)
+            plan="$2"; shift 2 ;;
+        -)
+            fstab+="$(cat)"$'\n'; shift ;;
+        *)
+            fstab+="$(< "$1")"$'\n' || return; shift ;;
+        esac
+    done
+
+    printf "%s\0%s\0%s\0%s\0" "${root}" "${pass}" "${plan}" "${fstab}" >&"${wfd}" || return
+    read -r -d '' -u "${rfd}" status || return
+    ! grep -q "^failed " <<< "${status}"
+}
@@ -20,6 +20,7 @@ readonly environ_dirs=("${ENROOT_SYSCONF_PATH}/environ.d" "${ENROOT_CONFIG_PATH}
 readonly environ_file="${ENROOT_RUNTIME_PATH}/environment"
 readonly mount_file="${ENROOT_RUNTIME_PATH}/fstab"
 readonly rc_file="${ENROOT_RUNTIME_PATH}/rc"
+readonly mount_plan_dir="${ENROOT_CACHE_PATH}/.mounts"
 readonly lock_file="/.lock"
 
 readonly bundle_dir="/.enroot"
@@ -61,33 +62,72 @@ runtime::_do_environ() {
     common::envfmt "${environ_file}"
 }
 
-runtime::_do_mounts_init() {
-    local -r rootfs="$1"
+runtime::_mount_plan() {
+    local key=
 
-    : > "${mount_file}"
+    # Key the mount plan on the fstab files and enroot-mount itself, as well as the environment variables referenced.
+    {
+        stat -L -c "%n %d %i %s %y %z" "$(command -v enroot-mount)" "$@" 2> /dev/null || :
+        for var in $(grep -oh '\${[A-Za-z_][A-Za-z0-9_]*}' "$@" 2> /dev/null | sort -u); do
+            var="${var:2:-1}"
+            printf "%s=%s\n" "${var}" "${!var-}"
+        done
+    } | sha256sum | common::read -r key x
 
-    # Generate the mount configuration file from the rootfs fstab.
-    common::envsubst "${rootfs}/etc/fstab" >> "${mount_file}"
+    printf "%s/%s" "${mount_plan_dir}" "${key}"
+}
+
+runtime::_do_mounts_init() {
+    local -r rootfs="$1"
+    local files=("${rootfs}/etc/fstab") plan= tmpfile= unshare_mounts=
 
-    # Generate the mount configuration file from the host directories.
     for dir in "${mount_dirs[@]}"; do
         if [ -d "${dir}" ]; then
             for file in $(common::runparts list .fstab "${dir}"); do
-                common::envsubst "${file}" >> "${mount_file}"
+                files+=("${file}")
             done
         fi
     done
+
+    # Reuse the mount configuration file and its compiled plan from the cache if nothing changed.
+    plan=$(runtime::_mount_plan "${files[@]}")
+    if [ -f "${plan}" ] && [ -f "${plan}.fstab" ]; then
+        cp "${plan}.fstab" "${mount_file}"
+    else
+        # Generate the mount configuration file from the rootfs fstab and the host directories.
+        for file in "${files[@]}"; do
+            common::envsubst "${file}"
+        done > "${mount_file}"
+
+        # Compile it into a mount plan and cache both for subsequent runs.
+        mkdir -p "${mount_plan_dir}"
+        tmpfile=$(mktemp -p "${mount_plan_dir}" "${plan##*/}.XXXXXXXXXX")
+        if enroot-mount --compile "${tmpfile}" "${mount_file}" 2> /dev/null; then
+            cp "${mount_file}" "${tmpfile}.fstab"
+            mv -f "${tmpfile}.fstab" "${plan}.fstab"
+            mv -f "${tmpfile}" "${plan}"
+        else
+            rm -f "${tmpfile}"
+            plan=""
+        fi
+    fi
+
     if [ -n "${ENROOT_UNSHARE_PID-}" ]; then
-        printf "none /proc none x-create=dir,x-detach,nofail,silent 0 -1\n" >> "${mount_file}"
-        printf "proc /proc proc x-create=dir,rw,nosuid,nodev,noexec,private 0 -1\n" >> "${mount_file}"
+        unshare_mounts+="none /proc none x-create=dir,x-detach,nofail,silent 0 -1\n"
+        unshare_mounts+="proc /proc proc x-create=dir,rw,nosuid,nodev,noexec,private 0 -1\n"
     fi
     if [ -n "${ENROOT_UNSHARE_NET-}" ]; then
-        printf "none /sys none x-create=dir,x-detach,nofail,silent 0 -1\n" >> "${mount_file}"
-        printf "sysfs /sys sysfs x-create=dir,ro,nosuid,nodev,noexec,private 0 -1\n" >> "${mount_file}"
+        unshare_mounts+="none /sys none x-create=dir,x-detach,nofail,silent 0 -1\n"
+        unshare_mounts+="sysfs /sys sysfs x-create=dir,ro,nosuid,nodev,noexec,private 0 -1\n"
     fi
+    printf "%b" "${unshare_mounts}" >> "${mount_file}"
 
     # Perform all the mounts specified in the configuration file with fs_passno -1.
-    enroot-mount --root "${rootfs}" --pass -1 "${mount_file}"
+    if [ -n "${plan}" ]; then
+        printf "%b" "${unshare_mounts}" | common::mount --root "${rootfs}" --pass -1 --plan "${plan}" -
+    else
+        common::mount --root "${rootfs}" --pass -1 "${mount_file}"
+    fi
 }
 
 runtime::_do_hooks() {
@@ -110,7 +150,7 @@ runtime::_do_hooks() {
     fi
 
     # Perform all the mounts specified in the configuration file with fs_passno unspecified (0).
-    enroot-mount --root "${rootfs}" "${mount_file}"
+    common::mount --root "${rootfs}" "${mount_file}"
     mv "${mount_file}~" "${mount_file}"
 
     # Format the environment file again in case hooks touched it.
@@ -132,7 +172,7 @@ runtime::_do_mounts_fini() {
     done >> "${mount_file}"
 
     # Perform all the mounts specified in the configuration file with fs_passno unspecified (0).
-    enroot-mount --root "${rootfs}" "${mount_file}"
+    common::mount --root "${rootfs}" "${mount_file}"
 }
 
 runtime::_do_rc() {
@@ -225,6 +265,7 @@ runtime::_start() {
     local -r _mounts="$1"; shift
     local -r _environ="$1"; shift
     local enroot_pid="${ENROOT_NSENTER_PID:-$$}"
+    local mount_pid= mount_wfd= mount_rfd=
 
     unset BASH_ENV
     unset ENROOT_NSENTER_PID
@@ -244,8 +285,14 @@ runtime::_start() {
         _rootfs="${ENROOT_RUNTIME_PATH}/overlay"
     fi
 
+    # Start a mount server shared by the runtime and the hooks, so that we don't pay for enroot-mount on every fstab.
+    mkfifo "${ENROOT_RUNTIME_PATH}/mount.in" "${ENROOT_RUNTIME_PATH}/mount.out"
+    enroot-mount --serve < "${ENROOT_RUNTIME_PATH}/mount.in" > "${ENROOT_RUNTIME_PATH}/mount.out" & mount_pid=$!
+    exec {mount_wfd}> "${ENROOT_RUNTIME_PATH}/mount.in" {mount_rfd}< "${ENROOT_RUNTIME_PATH}/mount.out"
+    export ENROOT_MOUNT_FD="${mount_wfd} ${mount_rfd}"
+
     # Setup the rootfs with slave propagation.
-    cat <<- EOF | enroot-mount -
+    cat <<- EOF | common::mount -
 	none $(common::mountpoint "${_rootfs}") none slave
 	${_rootfs} ${_rootfs} none bind,nosuid,nodev,slave
 	EOF
@@ -272,17 +319,23 @@ runtime::_start() {
 
     # Remount the rootfs readonly if necessary.
     if [ -z "${ENROOT_ROOTFS_WRITABLE-}" ]; then
-        enroot-mount - <<< "none ${_rootfs} none remount,bind,nosuid,nodev,ro"
+        common::mount - <<< "none ${_rootfs} none remount,bind,nosuid,nodev,ro"
     fi
 
     # Make the bundle directory and the lockfile readonly if present.
     if [ -d "${_rootfs}${bundle_dir}" ]; then
-        enroot-mount - <<< "${_rootfs}${bundle_dir} ${_rootfs}${bundle_dir} none rbind,nosuid,nodev,ro,private"
+        common::mount - <<< "${_rootfs}${bundle_dir} ${_rootfs}${bundle_dir} none rbind,nosuid,nodev,ro,private,x-recursive-attr"
     fi
     if [ -f "${_rootfs}${lock_file}" ]; then
-        enroot-mount - <<< "${_rootfs}${lock_file} ${_rootfs}${lock_file} none bind,nosuid,nodev,noexec,ro,private"
+        common::mount - <<< "${_rootfs}${lock_file} ${_rootfs}${lock_file} none bind,nosuid,nodev,noexec,ro,private"
     fi
 
+    # Stop the mount server, hooks could have left processes behind holding onto its pipes.
+    exec {mount_wfd}>&- {mount_rfd}<&-
+    unset ENROOT_MOUNT_FD
+    kill "${mount_pid}" 2> /dev/null || :
+    wait "${mount_pid}" 2> /dev/null || :
+
     # Switch to the new root, and invoke the command script.
     if [ -f "${rc_file}" ]; then
         exec enroot-switchroot ${ENROOT_LOGIN_SHELL:+--login} --rcfile "${rc_file}" --envfile "${environ_file}" "${_rootfs}" "$@"